@@ -7,11 +7,42 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/un.h>
+#include <dirent.h>
+#include <errno.h>
+
+#ifdef MANCBENCH
+/*
+ * gcc -DMANCBENCH -o mancbench mancsrv.c builds the benchmark/differential fuzzer instead of the server. The server's
+ * main becomes server_main, so the router test can run servers in child processes.
+ */
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+void *bench_malloc(size_t size);
+#define malloc(size) bench_malloc(size)
+#define main server_main
+#endif
 
 #define MAXNAME 80  /* maximum permitted name size, not including \0 */
 #define NPITS 6  /* number of pits on a side, not including the end pit */
 #define NPEBBLES 4 /* initial number of pebbles per pit */
 #define MAXMESSAGE (MAXNAME + 50) /* initial number of pebbles per pit */
+#define MAXSEATS (2 * FD_SETSIZE) /* seat slots handed out before the seating ring is compacted */
+#define STATS_MAGIC "MANCSTA1" /* first 8 bytes of a stats file */
+#define STATS_MINCAPACITY (1 << 16) /* number of record slots in a new stats file. always a power of 2 */
+#define STATS_MAXRATING 4096 /* ratings are kept in [0, STATS_MAXRATING) */
+#define STATS_START_RATING 1200
+#define STATS_K 32 /* most rating points a player can win or lose in a game */
+#define STATS_TOPN 5 /* number of players on the leaderboard shown at game over */
+#define STATS_LOCK_TIMEOUT_MS 5000 /* how long to wait for another server to unlock the stats file */
+#define HANDOFF_DRAIN_MS 100 /* how long a backend waits for late handoffs once its game is over */
+#define ROUTER_VNODES 64 /* points each backend gets on the router's hash ring */
+#define ROUTER_MAXBACKENDS 256
 
 int port = 3000;
 int listenfd;
@@ -22,12 +53,101 @@ struct player {
                         // pits[NPITS] is the end pit
     //other stuff undoubtedly needed here
     struct player *next;
+    struct player *prev;
     int player_num;
+    int seat; // index of this player in seating.seats
     int in_game; // 0 if they haven't yet been added to the game, 1 otherwise
     int my_turn; // 0 if it this players turn, 1 otherwise
 };
 struct player *playerlist = NULL;
 
+/*
+ * Turn order follows playerlist: the turn passes from a player to the next player in the game who connected before
+ * them, wrapping around to the most recent one. The seating ring keeps that order explicitly. Every connected
+ * player gets the next seat, so seats[] is ordered oldest to newest, and a fenwick tree over the seats counts the
+ * ones whose player is in the game, which lets us skip players that haven't been seated yet in O(log n).
+ */
+struct seating_ring {
+    struct player *seats[MAXSEATS]; // seats[i] is NULL if its player left
+    int seated[MAXSEATS + 1];       // fenwick tree (1-based) over seats. 1 for a player in the game, 0 otherwise
+    char is_seated[MAXSEATS];
+    int nseats;                     // number of seats handed out since the last compaction
+    int nseated;                    // number of players in the game
+    struct player *mover;           // the player whos turn it is (NULL if nobody's)
+};
+struct seating_ring seating;
+struct player *fd_owner[FD_SETSIZE]; // fd_owner[fd] is the player connected through fd
+
+/*
+ * Player stats persist across games in a memory-mapped file: a header followed by an open-addressed (linear
+ * probing) hash table of fixed size records keyed by name. Nothing is ever deleted, so empty slots are the only
+ * thing that ends a probe. For the leaderboard, every record is on a doubly-linked list of the records with the
+ * same rating, and the header keeps a bitmap of which ratings have any records, so top-n is a walk down from the
+ * highest rating. All of it lives in the file, so opening it is just an mmap.
+ */
+struct stats_record {
+    char name[MAXNAME+1]; // empty if this slot is free
+    int wins;
+    int games;
+    int rating;
+    long points;
+    int rank_prev; // record slots of the neighbours on this rating's list. -1 if none
+    int rank_next;
+};
+struct stats_header {
+    char magic[8];
+    int capacity; // number of record slots
+    int nrecords;
+    int rating_head[STATS_MAXRATING]; // first record slot on each rating's list. -1 if empty
+    unsigned long long rating_used[STATS_MAXRATING / 64]; // bit r is set if rating_head[r] != -1
+};
+/* a player who left a game before it was over. their loss is recorded when the game ends */
+struct stats_departure {
+    char name[MAXNAME+1];
+    char (*opponents)[MAXNAME+1]; // the players still in the game when they left
+    int nopponents;
+    struct stats_departure *next;
+};
+char *stats_path = NULL;
+int stats_fd = -1;
+struct stats_header *stats = NULL; // NULL if we aren't keeping stats
+struct stats_record *stats_records;
+struct stats_departure *stats_departures = NULL; // oldest first
+struct stats_departure **stats_departures_tail = &stats_departures;
+
+/*
+ * In router mode (-r dir), the server doesn't host a game. It asks each client which room they want, consistent
+ * hashes the room onto one of the backends listening on the unix sockets in dir, and hands the client's fd to that
+ * backend over the socket (SCM_RIGHTS), so the router never sees the game's traffic. A backend (-b path) is a normal
+ * server that gets its clients from the router instead of accept(). Each backend hosts one game, so rooms that hash
+ * to the same backend share its game.
+ *
+ * Backends are added by starting one on a new socket in dir and drained by removing its socket: the router picks up
+ * changes to dir on the next client, and a drained backend keeps playing the game it has until it's over.
+ */
+struct router_point {
+    unsigned int hash;
+    int backend; // index into router.backends
+};
+struct router_ring {
+    char *backends[ROUTER_MAXBACKENDS]; // socket paths
+    int nbackends;
+    struct router_point points[ROUTER_MAXBACKENDS * ROUTER_VNODES]; // sorted by hash
+    int npoints;
+    struct timespec dir_mtime; // dir's mtime when the backends were last read
+};
+struct router_client {
+    char room[MAXNAME+1]; // what's been read of the room name so far
+    int room_len;
+};
+char *router_dir = NULL;
+char *backend_path = NULL;
+ino_t backend_ino; // inode of the socket we bound at backend_path, so we only ever unlink our own
+int handoff_fds[FD_SETSIZE]; // router connections whose client fd hasn't come through yet
+int nhandoffs = 0;
+struct router_ring router;
+struct router_client *router_clients[FD_SETSIZE]; // clients that haven't picked a room yet, by fd
+
 
 extern void parseargs(int argc, char **argv);
 extern void makelistener();
@@ -37,6 +157,7 @@ extern void broadcast(char *s, struct player *exclusion, int prompt);  /* you ne
 
 // CONNECT/DISCONNECT PROCESS
 int new_conn_request(int fd);
+int connect_client(int client_fd);
 void set_client_name(struct player *new_client, char *name, int newline_idx);
 void add_user_to_game(struct player *client);
 void disconnect_player(struct player *quitter, int close_fd);
@@ -47,6 +168,35 @@ struct player *remove_from_list(int client_fd, char *msg, int disconnect);
 struct player *node_with_fd(int client_fd);
 void free_players();
 
+// SEATING RING OPS
+void ring_take_seat(struct player *player_ptr);
+void ring_sit_down(struct player *player_ptr);
+void ring_leave(struct player *player_ptr);
+struct player *ring_next(struct player *player_ptr);
+void ring_compact();
+
+// STATS STORE
+void stats_open(char *path);
+int stats_find(char *name, int insert);
+void stats_reserve(int nnew);
+void stats_record_game();
+void stats_queue_departure(struct player *quitter);
+int stats_lock();
+void stats_unlock();
+int stats_top(int *slots, int n);
+void stats_close();
+
+// ROUTER/BACKEND
+void run_router();
+void router_read_room(int client_fd);
+int router_find_point(char *room);
+int router_handoff(int client_fd, char *room);
+void router_write(int client_fd, char *msg);
+void make_backend_listener();
+int accept_handoff(int fd);
+int finish_handoff(int i);
+void drain_handoffs();
+
 // GAMEPLAY
 void prompt_for_move(int broadcast_prompt);
 void process_move(struct player *client, int pit_to_move);
@@ -60,6 +210,7 @@ int read_and_parse(int client_fd, int max_bytes, struct player *new_client);
 
 // UTILITY FUNCTIONS 
 void init_pebbles(struct player *player_ptr);
+int player_points(struct player *player_ptr);
 int find_newline_idx(const char *read_buf, int num_read);
 void write_to_client(int client_fd, char *msg);
 
@@ -69,7 +220,18 @@ int main(int argc, char **argv) {
     char msg[MAXMESSAGE];
     
     parseargs(argc, argv);
-    makelistener();     
+    if (router_dir != NULL){
+        run_router();
+        return 0;
+    }
+    if (stats_path != NULL){
+        stats_open(stats_path);
+    }
+    if (backend_path != NULL){
+        make_backend_listener();
+    }else{
+        makelistener();
+    }
 
     int max_fd = listenfd;
     FD_ZERO(&monitored_fds);
@@ -83,14 +245,32 @@ int main(int argc, char **argv) {
         }
         if (FD_ISSET(listenfd, &monitored_fds_cpy)){
             // New connection request received
-            int new_client_fd;
-            new_client_fd = new_conn_request(listenfd);
-            if (new_client_fd > max_fd){
-                max_fd = new_client_fd; 
+            // a backend gets the router's connection here. the client's fd comes through it later
+            int new_fd;
+            new_fd = (backend_path != NULL) ? accept_handoff(listenfd) : new_conn_request(listenfd);
+            if (new_fd > -1){
+                if (new_fd > max_fd){
+                    max_fd = new_fd;
+                }
+                FD_SET(new_fd, &monitored_fds); // add it to our watch-pool
             }
-            FD_SET(new_client_fd, &monitored_fds); // add it to our watch-pool
 
         }
+        // Take the client fds the router has sent over
+        int i = 0;
+        while (i < nhandoffs){
+            if (FD_ISSET(handoff_fds[i], &monitored_fds_cpy)){
+                int new_client_fd = finish_handoff(i); // replaces handoff_fds[i] with the last one
+                if (new_client_fd > -1 && connect_client(new_client_fd) > -1){
+                    if (new_client_fd > max_fd){
+                        max_fd = new_client_fd;
+                    }
+                    FD_SET(new_client_fd, &monitored_fds);
+                }
+            }else{
+                i++;
+            }
+        }
         // Check the clients to see if any of them sent data
         int clients_found = 0;
         struct player *p = playerlist;
@@ -105,36 +285,76 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (backend_path != NULL){
+        // stop the router from sending anyone else to this game
+        struct stat st;
+        if (stat(backend_path, &st) == 0 && st.st_ino == backend_ino){
+            unlink(backend_path);
+        }
+        // the router may have handed us clients while the last move was being made. send them back
+        drain_handoffs();
+    }
     broadcast("Game over!", NULL, 0);
     printf("Game over!\n");
     for (struct player *p = playerlist; p; p = p->next) {
         if (p->in_game){
-            int points = 0;
-            for (int i = 0; i <= NPITS; i++) {
-                points += p->pits[i];
-            }
+            int points = player_points(p);
             printf("%s has %d points\r\n", p->name, points);
             snprintf(msg, MAXMESSAGE, "%s has %d points", p->name, points);
             broadcast(msg, NULL, 0);
         }
     }
+    if (stats != NULL){
+        stats_record_game();
+        int top[STATS_TOPN];
+        char leaderboard[STATS_TOPN][MAXMESSAGE];
+        int ntop = 0;
+        if (stats_lock() == 0){
+            ntop = stats_top(top, STATS_TOPN);
+            for (int i = 0; i < ntop; i++){
+                struct stats_record *r = &stats_records[top[i]];
+                snprintf(leaderboard[i], MAXMESSAGE, "%d. %s rating %d (%d wins in %d games)", i + 1, r->name,
+                         r->rating, r->wins, r->games);
+            }
+            stats_unlock();
+        }
+        stats_close();
+        broadcast("Leaderboard:", NULL, 0);
+        printf("Leaderboard:\n");
+        for (int i = 0; i < ntop; i++){
+            printf("%s\n", leaderboard[i]);
+            broadcast(leaderboard[i], NULL, 0);
+        }
+    }
     return 0;
 }
+#ifdef MANCBENCH
+#undef main
+#endif
 
 
 void parseargs(int argc, char **argv) {
     int c, status = 0;
-    while ((c = getopt(argc, argv, "p:")) != EOF) {
+    while ((c = getopt(argc, argv, "p:s:r:b:")) != EOF) {
         switch (c) {
         case 'p':
             port = strtol(optarg, NULL, 0);
             break;
+        case 's':
+            stats_path = optarg;
+            break;
+        case 'r':
+            router_dir = optarg;
+            break;
+        case 'b':
+            backend_path = optarg;
+            break;
         default:
             status++;
         }
     }
-    if (status || optind != argc) {
-        fprintf(stderr, "usage: %s [-p port]\n", argv[0]);
+    if (status || optind != argc || (router_dir != NULL && backend_path != NULL)) {
+        fprintf(stderr, "usage: %s [-p port] [-s stats_file] [-r backend_dir | -b backend_socket]\n", argv[0]);
         exit(1);
     }
 }
@@ -217,13 +437,9 @@ int game_is_over() { /* boolean */
  * requesting to connect
  *
  * @param fd the file descriptor through which the connection request was received
- * @return the communication file descriptor for the client
+ * @return the communication file descriptor for the client. -1 if the client was dropped
  */
 int new_conn_request(int fd){
-    // initialize player
-    struct player *player_ptr = malloc(sizeof(struct player));
-    add_player_to_head(player_ptr, 1);
-
     int new_client_fd = accept(fd, NULL, NULL);
     if (new_client_fd < 0){
         perror("server: accept");
@@ -231,12 +447,33 @@ int new_conn_request(int fd){
         close(fd);
         free_players();
         exit(1);
-    }else{
-        char *welcome_str = "Welcome to Mancala. What is your name?";
-        write_to_client(new_client_fd, welcome_str);
     }
+    return connect_client(new_client_fd);
+}
+
+/**
+ * Set up a player for a client that has just connected, either directly or through the router
+ *
+ * @param new_client_fd the client's file descriptor
+ * @return new_client_fd. -1 if the client was dropped
+ */
+int connect_client(int new_client_fd){
+    if (new_client_fd >= FD_SETSIZE){
+        // select() can't watch it and fd_owner can't hold it
+        fprintf(stderr, "Too many clients. Dropped a new connection.\n");
+        close(new_client_fd);
+        return -1;
+    }
+
+    // initialize player
+    struct player *player_ptr = malloc(sizeof(struct player));
+    add_player_to_head(player_ptr, 1);
+
+    char *welcome_str = "Welcome to Mancala. What is your name?";
+    write_to_client(new_client_fd, welcome_str);
     printf("Accepted a new connection\n");
     player_ptr->fd = new_client_fd;
+    fd_owner[new_client_fd] = player_ptr;
     return new_client_fd;
 }
 
@@ -296,6 +533,7 @@ void add_user_to_game(struct player *client){
         char *server_msg = malloc(MAXMESSAGE+1);
         snprintf(server_msg, MAXMESSAGE+1, "%s has joined the game.", new_user);
         client->in_game = 1;
+        ring_sit_down(client);
         /*if (playerlist != client){ // check if someone else connected and joined before they entered their name
             remove_from_list(client->fd, NULL, 0);
             add_player_to_head(client, 0);
@@ -349,14 +587,25 @@ void add_player_to_head(struct player *player_ptr, int reset_vals){
         player_ptr->player_num = 1;
         player_ptr->my_turn = 1;
     }
+    if (player_ptr->my_turn){
+        seating.mover = player_ptr;
+    }
     if (reset_vals){
         player_ptr->name[0] = '\0';
         player_ptr->fd = -1;
         player_ptr->in_game = 0;
         init_pebbles(player_ptr);
     }
+    player_ptr->prev = NULL;
     player_ptr->next = playerlist;
+    if (playerlist != NULL){
+        playerlist->prev = player_ptr;
+    }
     playerlist = player_ptr;
+    ring_take_seat(player_ptr);
+    if (player_ptr->in_game){
+        ring_sit_down(player_ptr);
+    }
 }
 
 
@@ -372,27 +621,28 @@ void add_player_to_head(struct player *player_ptr, int reset_vals){
  *                    2 if they should be removed AND have their file descriptor closed
  */
 struct player *remove_from_list(int client_fd, char *msg, int disconnect) {
-    struct player *removed_player = NULL;
-
     write_to_client(client_fd, msg);
 
-    struct player *p = playerlist;
-    if (p != NULL && p->fd == client_fd) { //  see if the last player that connected/last player in game is quitting
-        removed_player = playerlist;
-        playerlist = playerlist->next;
-    }else {
-        while (p != NULL) {
-            p->player_num -= 1;
-            if (p->next != NULL && p->next->fd == client_fd) {
-                removed_player = p->next;
-                p->next = removed_player->next;
-                break;
-            }
-            p = p->next;
+    struct player *removed_player = node_with_fd(client_fd);
+    if (removed_player != NULL){
+        if (removed_player->prev != NULL){
+            removed_player->prev->next = removed_player->next;
+        }else{
+            playerlist = removed_player->next;
+        }
+        if (removed_player->next != NULL){
+            removed_player->next->prev = removed_player->prev;
+        }
+        fd_owner[client_fd] = NULL;
+        ring_leave(removed_player);
+        if (stats != NULL && disconnect && removed_player->in_game){
+            stats_queue_departure(removed_player);
+        }
+        if (removed_player->my_turn && !set_next_mover(removed_player)){
+            // nobody left in the game to take the turn
+            removed_player->my_turn = 0;
+            seating.mover = NULL;
         }
-    }
-    if (removed_player != NULL && removed_player->my_turn){
-        set_next_mover(removed_player);
     }
     if (disconnect) {
         if (disconnect == 2){
@@ -424,23 +674,19 @@ void free_players(){
  * @param broadcast_prompt: 1 if the next turn should be announced to everyone else in the game, 0 otherwise
  */
 void prompt_for_move(int broadcast_prompt) {
-    struct player *p = playerlist;
-    while (p != NULL){
+    struct player *p = seating.mover;
+    if (p != NULL && p->in_game && p->my_turn){
         // prompt current player for move
-        if (p->in_game && p->my_turn){
-            char *move_prompt = "Your move?";
-            write_to_client(p->fd, move_prompt);
-            if (broadcast_prompt){
-                // tell everyone whos move it is
-                char *move_msg = malloc(sizeof(char) * (MAXMESSAGE +1));
-                snprintf(move_msg, MAXMESSAGE+1, "It is %s's move.", p->name);
-                broadcast(move_msg, p, 0);
-                printf("%s\n", move_msg);
-                free(move_msg);
-            }
-            break;
+        char *move_prompt = "Your move?";
+        write_to_client(p->fd, move_prompt);
+        if (broadcast_prompt){
+            // tell everyone whos move it is
+            char *move_msg = malloc(sizeof(char) * (MAXMESSAGE +1));
+            snprintf(move_msg, MAXMESSAGE+1, "It is %s's move.", p->name);
+            broadcast(move_msg, p, 0);
+            printf("%s\n", move_msg);
+            free(move_msg);
         }
-        p = p->next;
     }
 }
 
@@ -672,27 +918,22 @@ int find_newline_idx(const char *read_buf, int num_read){
 
 
 /**
- * Find the next valid player in the linkedlist, and set their my_turn = 1
+ * Find the next player in the game from the seating ring, and set their my_turn = 1
  *
  * @param current_mover: the player whos turn it currently is
  * @return: 0 on failure, 1 on success
  */
 int set_next_mover(struct player *current_mover){
-    struct player *start = playerlist;
-    if (current_mover != NULL && current_mover->next != NULL){
-        start = current_mover->next;
+    struct player *next = ring_next(current_mover);
+    if (next == NULL){
+        return 0;
     }
-    while (start != NULL){
-        if (start->in_game){
-            if (current_mover != NULL){
-                current_mover->my_turn = 0;
-            }
-            start->my_turn = 1;
-            return 1;
-        }
-        start = start->next;
+    if (current_mover != NULL){
+        current_mover->my_turn = 0;
     }
-    return 0;
+    next->my_turn = 1;
+    seating.mover = next;
+    return 1;
 }
 
 
@@ -703,11 +944,148 @@ int set_next_mover(struct player *current_mover){
  * @return
  */
 struct player *node_with_fd(int client_fd){
-    struct player *p = playerlist;
-    while (p != NULL && p->fd != client_fd){
-        p = p->next;
+    if (client_fd < 0 || client_fd >= FD_SETSIZE){
+        return NULL;
+    }
+    return fd_owner[client_fd];
+}
+
+
+/** Add delta to seat_idx's entry in the seating ring's fenwick tree **/
+void ring_update(int seat_idx, int delta){
+    for (int i = seat_idx + 1; i <= MAXSEATS; i += i & -i){
+        seating.seated[i] += delta;
+    }
+}
+
+
+/** Return the number of players in the game sitting in seats [0, seat_idx) **/
+int ring_count_below(int seat_idx){
+    int count = 0;
+    for (int i = seat_idx; i > 0; i -= i & -i){
+        count += seating.seated[i];
+    }
+    return count;
+}
+
+
+/** Return the index of the k'th (1-based) seat whose player is in the game **/
+int ring_kth_seated(int k){
+    int pos = 0;
+    int step = 1;
+    while (step * 2 <= MAXSEATS){
+        step *= 2;
+    }
+    for (; step > 0; step /= 2){
+        if (pos + step <= MAXSEATS && seating.seated[pos + step] < k){
+            pos += step;
+            k -= seating.seated[pos];
+        }
+    }
+    return pos; // fenwick index pos + 1, so seat index pos
+}
+
+
+/**
+ * Give player_ptr the newest seat in the ring, compacting the ring first if we've run out of seats
+ *
+ * @param player_ptr
+ */
+void ring_take_seat(struct player *player_ptr){
+    if (seating.nseats == MAXSEATS){
+        ring_compact();
+    }
+    player_ptr->seat = seating.nseats;
+    seating.seats[seating.nseats] = player_ptr;
+    seating.is_seated[seating.nseats] = 0;
+    seating.nseats += 1;
+}
+
+
+/**
+ * Mark player_ptr's seat as belonging to a player in the game, so turns can land on it
+ *
+ * @param player_ptr
+ */
+void ring_sit_down(struct player *player_ptr){
+    if (!seating.is_seated[player_ptr->seat]){
+        seating.is_seated[player_ptr->seat] = 1;
+        seating.nseated += 1;
+        ring_update(player_ptr->seat, 1);
+    }
+}
+
+
+/**
+ * Give up player_ptr's seat. player_ptr->seat is left as is so ring_next can still find who sits after it.
+ *
+ * @param player_ptr
+ */
+void ring_leave(struct player *player_ptr){
+    int seat_idx = player_ptr->seat;
+    if (seating.is_seated[seat_idx]){
+        seating.is_seated[seat_idx] = 0;
+        seating.nseated -= 1;
+        ring_update(seat_idx, -1);
+    }
+    seating.seats[seat_idx] = NULL;
+}
+
+
+/**
+ * Return the player in the game whos turn comes after player_ptr's: the closest one who connected before them, or
+ * the newest one if there is none.
+ *
+ * @param player_ptr: (optional) the player to start from. If NULL, the newest player in the game is returned
+ * @return the next player, or NULL if nobody is in the game
+ */
+struct player *ring_next(struct player *player_ptr){
+    if (seating.nseated == 0){
+        return NULL;
+    }
+    int k = seating.nseated;
+    if (player_ptr != NULL){
+        int below = ring_count_below(player_ptr->seat);
+        if (below > 0){
+            k = below;
+        }
+    }
+    return seating.seats[ring_kth_seated(k)];
+}
+
+
+/**
+ * Slide every remaining player down into the seats left by players who quit, keeping their order, and rebuild the
+ * fenwick tree. Only called when all MAXSEATS seats have been handed out, and at most FD_SETSIZE players can be
+ * connected at once, so this costs O(1) amortized per connection.
+ */
+void ring_compact(){
+    int nseats = 0;
+    memset(seating.seated, 0, sizeof(seating.seated));
+    for (int i = 0; i < seating.nseats; i++){
+        struct player *p = seating.seats[i];
+        if (p != NULL){
+            seating.seats[nseats] = p;
+            seating.is_seated[nseats] = seating.is_seated[i];
+            p->seat = nseats;
+            nseats += 1;
+        }
+    }
+    for (int i = nseats; i < seating.nseats; i++){
+        seating.seats[i] = NULL;
+        seating.is_seated[i] = 0;
+    }
+    seating.nseats = nseats;
+    // linear fenwick build
+    for (int i = 1; i <= MAXSEATS; i++){
+        if (i <= nseats){
+            seating.seated[i] += seating.is_seated[i - 1];
+        }
+        int parent = i + (i & -i);
+        if (parent <= MAXSEATS){
+            seating.seated[parent] += seating.seated[i];
+        }
     }
-    return p;
 }
 
 /** Set the pebbles for player_ptr's pits **/
@@ -724,6 +1102,15 @@ void init_pebbles(struct player *player_ptr){
     player_ptr->pits[NPITS] = 0;
 }
 
+/** Return the number of pebbles player_ptr has in all their pits, including the end pit **/
+int player_points(struct player *player_ptr){
+    int points = 0;
+    for (int i = 0; i <= NPITS; i++) {
+        points += player_ptr->pits[i];
+    }
+    return points;
+}
+
 /**
  * Send out a message to every player in the game
  *
@@ -742,4 +1129,1693 @@ void broadcast(char *s, struct player *exclusion, int prompt) {
     if (prompt){
         prompt_for_move(1);
     }
-}
\ No newline at end of file
+}
+
+/** Return the size in bytes of a stats file with capacity record slots **/
+size_t stats_file_size(int capacity){
+    return sizeof(struct stats_header) + (size_t) capacity * sizeof(struct stats_record);
+}
+
+/** Map the stats file open on fd into memory, and make it the one we're using **/
+void stats_map(int fd, int capacity){
+    void *map = mmap(NULL, stats_file_size(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED){
+        perror("stats: mmap");
+        exit(1);
+    }
+    stats_fd = fd;
+    stats = map;
+    stats_records = (struct stats_record *) (stats + 1);
+}
+
+/**
+ * Make the file open on fd an empty stats file with capacity record slots, and map it
+ *
+ * @param fd
+ * @param capacity: the number of record slots. Must be a power of 2
+ */
+void stats_init(int fd, int capacity){
+    // the records start out zeroed (and free) without being written
+    if (ftruncate(fd, (off_t) stats_file_size(capacity)) == -1){
+        perror("stats: ftruncate");
+        exit(1);
+    }
+    stats_map(fd, capacity);
+    memcpy(stats->magic, STATS_MAGIC, sizeof(stats->magic));
+    stats->capacity = capacity;
+    stats->nrecords = 0;
+    for (int i = 0; i < STATS_MAXRATING; i++){
+        stats->rating_head[i] = -1;
+    }
+}
+
+/**
+ * Create an empty stats file at path, truncating anything that was there, and map it. It's left locked.
+ *
+ * @param path
+ * @param capacity: the number of record slots. Must be a power of 2
+ */
+void stats_create(char *path, int capacity){
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || flock(fd, LOCK_EX) == -1){
+        perror(path);
+        exit(1);
+    }
+    stats_init(fd, capacity);
+}
+
+/**
+ * Map the stats file open on fd, making it an empty one if it has nothing in it
+ *
+ * Precondition: fd is locked
+ *
+ * @param fd
+ * @param path: the file's path, for error messages
+ */
+void stats_load(int fd, char *path){
+    struct stat st;
+    if (fstat(fd, &st) == -1){
+        perror(path);
+        exit(1);
+    }
+    if (st.st_size == 0){
+        stats_init(fd, STATS_MINCAPACITY);
+        return;
+    }
+    struct stats_header header;
+    // stats_find masks hashes with capacity - 1, so anything but a power of 2 would break probing
+    if ((size_t) st.st_size < sizeof(header) || read(fd, &header, sizeof(header)) != (ssize_t) sizeof(header) ||
+        memcmp(header.magic, STATS_MAGIC, sizeof(header.magic)) != 0 ||
+        header.capacity <= 0 || (header.capacity & (header.capacity - 1)) != 0 ||
+        (size_t) st.st_size != stats_file_size(header.capacity)){
+        fprintf(stderr, "%s is not a stats file\n", path);
+        exit(1);
+    }
+    stats_map(fd, header.capacity);
+}
+
+/**
+ * Map the stats file at path, creating it if it doesn't exist or is empty
+ *
+ * @param path
+ */
+/**
+ * Lock the file open on fd, waiting at most STATS_LOCK_TIMEOUT_MS for whoever has it, so a stopped or stuck server
+ * holding the lock can't hang this one
+ *
+ * @return 0 if fd is locked, -1 if we gave up
+ */
+int stats_flock(int fd){
+    for (int waited_ms = 0; flock(fd, LOCK_EX | LOCK_NB) == -1; waited_ms += 10){
+        if (errno != EWOULDBLOCK || waited_ms >= STATS_LOCK_TIMEOUT_MS){
+            perror("stats: flock");
+            return -1;
+        }
+        usleep(10000);
+    }
+    return 0;
+}
+
+void stats_open(char *path){
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1 || stats_flock(fd) == -1){
+        perror(path);
+        exit(1);
+    }
+    stats_load(fd, path);
+    stats_unlock();
+}
+
+/**
+ * Lock the stats file, so servers sharing it take turns changing it. If another server grew the file (see
+ * stats_reserve) since we mapped it, switch to the new one at stats_path. This can wait on other servers, so it's
+ * only ever called before or after the game, never from the select loop.
+ *
+ * @return 0 if the stats file is locked, -1 if we gave up waiting for it
+ */
+int stats_lock(){
+    if (stats_flock(stats_fd) == -1){
+        return -1;
+    }
+    while (1){
+        struct stat path_st, fd_st;
+        if (stat(stats_path, &path_st) == -1 || fstat(stats_fd, &fd_st) == -1 ||
+            (path_st.st_dev == fd_st.st_dev && path_st.st_ino == fd_st.st_ino)){
+            return 0; // if stats_path is gone, we keep the file we have
+        }
+        int fd = open(stats_path, O_RDWR);
+        if (fd == -1){
+            return 0;
+        }
+        if (stats_flock(fd) == -1){
+            close(fd);
+            stats_unlock();
+            return -1;
+        }
+        munmap(stats, stats_file_size(stats->capacity));
+        close(stats_fd);
+        stats_load(fd, stats_path); // and check it hasn't been replaced again
+    }
+}
+
+void stats_unlock(){
+    flock(stats_fd, LOCK_UN);
+}
+
+/** Unmap the stats file. The kernel writes back whatever hasn't been written yet. **/
+void stats_close(){
+    if (stats != NULL){
+        munmap(stats, stats_file_size(stats->capacity));
+        close(stats_fd);
+        stats = NULL;
+    }
+}
+
+/** FNV-1a hash of name **/
+unsigned int hash_name(char *name){
+    unsigned int hash = 2166136261u;
+    for (; *name; name++){
+        hash = (hash ^ (unsigned char) *name) * 16777619u;
+    }
+    return hash;
+}
+
+/** Put the record in slot at the front of its rating's list **/
+void stats_rank_link(int slot){
+    struct stats_record *r = &stats_records[slot];
+    r->rank_prev = -1;
+    r->rank_next = stats->rating_head[r->rating];
+    if (r->rank_next != -1){
+        stats_records[r->rank_next].rank_prev = slot;
+    }
+    stats->rating_head[r->rating] = slot;
+    stats->rating_used[r->rating / 64] |= 1ULL << (r->rating % 64);
+}
+
+/** Take the record in slot off its rating's list **/
+void stats_rank_unlink(int slot){
+    struct stats_record *r = &stats_records[slot];
+    if (r->rank_prev != -1){
+        stats_records[r->rank_prev].rank_next = r->rank_next;
+    }else{
+        stats->rating_head[r->rating] = r->rank_next;
+    }
+    if (r->rank_next != -1){
+        stats_records[r->rank_next].rank_prev = r->rank_prev;
+    }
+    if (stats->rating_head[r->rating] == -1){
+        stats->rating_used[r->rating / 64] &= ~(1ULL << (r->rating % 64));
+    }
+}
+
+/**
+ * Return the slot of the record for name
+ *
+ * Precondition: if insert is 1, stats_reserve must have made room for the record
+ *
+ * @param name
+ * @param insert: 1 if a new record should be created when name doesn't have one, 0 otherwise
+ * @return the slot, or -1 if name has no record and insert is 0
+ */
+int stats_find(char *name, int insert){
+    int mask = stats->capacity - 1;
+    int slot = (int) (hash_name(name) & mask);
+    while (stats_records[slot].name[0] != '\0'){
+        if (strcmp(stats_records[slot].name, name) == 0){
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    if (!insert){
+        return -1;
+    }
+    struct stats_record *r = &stats_records[slot];
+    snprintf(r->name, MAXNAME+1, "%s", name);
+    r->wins = 0;
+    r->games = 0;
+    r->points = 0;
+    r->rating = STATS_START_RATING;
+    stats_rank_link(slot);
+    stats->nrecords += 1;
+    return slot;
+}
+
+/**
+ * Make sure nnew records can be added while keeping the table at most 3/4 full. If they can't, rehash every record
+ * into a bigger file next to the current one and rename it over the current one.
+ *
+ * Precondition: the stats file is locked. If it grows, the new one is left locked instead.
+ *
+ * @param nnew
+ */
+void stats_reserve(int nnew){
+    int capacity = stats->capacity;
+    while ((long) (stats->nrecords + nnew) * 4 > (long) capacity * 3){
+        capacity *= 2;
+    }
+    if (capacity == stats->capacity){
+        return;
+    }
+    struct stats_header *old = stats;
+    struct stats_record *old_records = stats_records;
+    int old_fd = stats_fd;
+
+    char *tmp_path = malloc(strlen(stats_path) + 5);
+    sprintf(tmp_path, "%s.new", stats_path);
+    stats_create(tmp_path, capacity);
+    for (int i = 0; i < old->capacity; i++){
+        if (old_records[i].name[0] != '\0'){
+            int slot = stats_find(old_records[i].name, 1);
+            stats_rank_unlink(slot);
+            memcpy(&stats_records[slot], &old_records[i], sizeof(struct stats_record));
+            stats_rank_link(slot);
+        }
+    }
+    if (rename(tmp_path, stats_path) == -1){
+        perror("stats: rename");
+        exit(1);
+    }
+    free(tmp_path);
+    munmap(old, stats_file_size(old->capacity));
+    close(old_fd);
+}
+
+/**
+ * Return the score a player rated rating is expected to get against one rated opp_rating, between 0 and 1. This
+ * is a straight line through the middle of the Elo curve, so we don't need libm.
+ */
+double stats_expected_score(int rating, int opp_rating){
+    double expected = 0.5 + (rating - opp_rating) / 800.0;
+    if (expected < 0){
+        return 0;
+    }else if (expected > 1){
+        return 1;
+    }
+    return expected;
+}
+
+/**
+ * Return rating moved by surprise, the sum over nopponents opponents of (actual score - expected score), kept in
+ * [0, STATS_MAXRATING)
+ */
+int stats_adjusted_rating(int rating, double surprise, int nopponents){
+    rating += (int) (STATS_K * surprise / nopponents + (surprise < 0 ? -0.5 : 0.5));
+    if (rating < 0){
+        return 0;
+    }else if (rating >= STATS_MAXRATING){
+        return STATS_MAXRATING - 1;
+    }
+    return rating;
+}
+
+/** Give the record in slot a new rating, moving it to that rating's list **/
+void stats_set_rating(int slot, int rating){
+    if (rating != stats_records[slot].rating){
+        stats_rank_unlink(slot);
+        stats_records[slot].rating = rating;
+        stats_rank_link(slot);
+    }
+}
+
+/**
+ * Record the game lost by a player who left before it was over, against everyone who was still in it then
+ *
+ * Precondition: the stats file is locked, with room for the quitter and their opponents
+ *
+ * @param departure
+ */
+void stats_record_departure(struct stats_departure *departure){
+    int slot = stats_find(departure->name, 1);
+    int rating = stats_records[slot].rating;
+    double surprise = 0;
+    for (int i = 0; i < departure->nopponents; i++){
+        surprise -= stats_expected_score(rating, stats_records[stats_find(departure->opponents[i], 1)].rating);
+    }
+    stats_records[slot].games += 1;
+    stats_set_rating(slot, stats_adjusted_rating(rating, surprise, departure->nopponents));
+}
+
+/**
+ * Add the game that just ended to the stats of everyone in it, and of everyone who left it early (see
+ * stats_queue_departure). The players with the most points win, and every player's rating moves by how they did
+ * against each other player compared to what their ratings predicted. If only one player is left in the game, only
+ * the departures are recorded.
+ */
+void stats_record_game(){
+    int nplayers = 0, nnew = 0, best = -1;
+    for (struct player *p = playerlist; p; p = p->next){
+        if (p->in_game){
+            nplayers += 1;
+        }
+    }
+    for (struct stats_departure *d = stats_departures; d; d = d->next){
+        nnew += 1 + d->nopponents;
+    }
+    if (nplayers < 2){
+        nplayers = 0;
+    }
+    if (nplayers + nnew == 0){
+        return;
+    }
+    if (stats_lock() == -1){
+        fprintf(stderr, "stats: couldn't lock %s. This game wasn't recorded.\n", stats_path);
+        return;
+    }
+    stats_reserve(nplayers + nnew);
+    while (stats_departures != NULL){
+        struct stats_departure *d = stats_departures;
+        stats_record_departure(d);
+        stats_departures = d->next;
+        free(d->opponents);
+        free(d);
+    }
+    stats_departures_tail = &stats_departures;
+    if (nplayers == 0){
+        msync(stats, stats_file_size(stats->capacity), MS_ASYNC);
+        stats_unlock();
+        return;
+    }
+
+    int *slots = malloc(sizeof(int) * nplayers);
+    int *points = malloc(sizeof(int) * nplayers);
+    int *old_ratings = malloc(sizeof(int) * nplayers);
+    int i = 0;
+    for (struct player *p = playerlist; p; p = p->next){
+        if (p->in_game){
+            slots[i] = stats_find(p->name, 1);
+            points[i] = player_points(p);
+            old_ratings[i] = stats_records[slots[i]].rating;
+            if (points[i] > best){
+                best = points[i];
+            }
+            i++;
+        }
+    }
+    for (i = 0; i < nplayers; i++){
+        struct stats_record *r = &stats_records[slots[i]];
+        r->games += 1;
+        r->points += points[i];
+        if (points[i] == best){
+            r->wins += 1;
+        }
+        double surprise = 0;
+        for (int j = 0; j < nplayers; j++){
+            if (j != i){
+                double score = (points[i] > points[j]) ? 1 : (points[i] == points[j]) ? 0.5 : 0;
+                surprise += score - stats_expected_score(old_ratings[i], old_ratings[j]);
+            }
+        }
+        stats_set_rating(slots[i], stats_adjusted_rating(old_ratings[i], surprise, nplayers - 1));
+    }
+    // start writing it back, but don't wait for it
+    msync(stats, stats_file_size(stats->capacity), MS_ASYNC);
+    stats_unlock();
+    free(slots);
+    free(points);
+    free(old_ratings);
+}
+
+/**
+ * Remember that quitter left the game before it was over, so stats_record_game can record it as a loss against
+ * everyone still in it. Nothing touches the stats file until then, so a departure never holds up the game.
+ * If nobody else is in the game, nothing is recorded.
+ *
+ * Precondition: quitter has already been taken out of playerlist
+ *
+ * @param quitter
+ */
+void stats_queue_departure(struct player *quitter){
+    int nopponents = 0;
+    for (struct player *p = playerlist; p; p = p->next){
+        if (p->in_game){
+            nopponents += 1;
+        }
+    }
+    if (nopponents == 0){
+        return;
+    }
+    struct stats_departure *departure = malloc(sizeof(struct stats_departure));
+    departure->opponents = malloc(sizeof(departure->opponents[0]) * nopponents);
+    departure->nopponents = 0;
+    snprintf(departure->name, MAXNAME+1, "%s", quitter->name);
+    for (struct player *p = playerlist; p; p = p->next){
+        if (p->in_game){
+            snprintf(departure->opponents[departure->nopponents++], MAXNAME+1, "%s", p->name);
+        }
+    }
+    departure->next = NULL;
+    *stats_departures_tail = departure;
+    stats_departures_tail = &departure->next;
+}
+
+/**
+ * Find the n highest rated players, best first
+ *
+ * @param slots: where to put the slots of their records
+ * @param n
+ * @return the number of slots filled in (less than n if there aren't n players)
+ */
+int stats_top(int *slots, int n){
+    int count = 0;
+    for (int word = STATS_MAXRATING / 64 - 1; word >= 0 && count < n; word--){
+        unsigned long long used = stats->rating_used[word];
+        while (used != 0 && count < n){
+            int bit = 63 - __builtin_clzll(used);
+            used &= ~(1ULL << bit);
+            for (int slot = stats->rating_head[word * 64 + bit]; slot != -1 && count < n;
+                 slot = stats_records[slot].rank_next){
+                slots[count++] = slot;
+            }
+        }
+    }
+    return count;
+}
+
+
+/**
+ * Write msg to a client that isn't in a game. Unlike write_to_client, a client that's gone is only their problem.
+ */
+void router_write(int client_fd, char *msg){
+    char write_buf[MAXMESSAGE+1];
+    snprintf(write_buf, MAXMESSAGE+1, "%s\r\n", msg);
+    if (send(client_fd, write_buf, strlen(write_buf), MSG_NOSIGNAL) == -1){
+        perror("router: send");
+    }
+}
+
+/** Hash s onto the router's ring. FNV-1a doesn't spread similar names out well, so finish it with a mixer **/
+unsigned int router_hash(char *s){
+    unsigned int h = hash_name(s);
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+int router_point_cmp(const void *a, const void *b){
+    unsigned int ha = ((const struct router_point *) a)->hash, hb = ((const struct router_point *) b)->hash;
+    return (ha > hb) - (ha < hb);
+}
+
+/**
+ * Rebuild the ring from the *.sock files in router_dir, if router_dir has changed since we last did
+ */
+void router_rescan(){
+    struct stat st;
+    if (stat(router_dir, &st) == -1){
+        perror(router_dir);
+        return;
+    }
+    if (router.nbackends > 0 && st.st_mtim.tv_sec == router.dir_mtime.tv_sec &&
+        st.st_mtim.tv_nsec == router.dir_mtime.tv_nsec){
+        return;
+    }
+    DIR *dir = opendir(router_dir);
+    if (dir == NULL){
+        perror(router_dir);
+        return;
+    }
+    router.dir_mtime = st.st_mtim;
+    for (int i = 0; i < router.nbackends; i++){
+        free(router.backends[i]);
+    }
+    router.nbackends = 0;
+    router.npoints = 0;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && router.nbackends < ROUTER_MAXBACKENDS){
+        int len = (int) strlen(entry->d_name);
+        if (len <= 5 || strcmp(entry->d_name + len - 5, ".sock") != 0){
+            continue;
+        }
+        char *path = malloc(strlen(router_dir) + len + 2);
+        sprintf(path, "%s/%s", router_dir, entry->d_name);
+        // points are placed by socket name, so a backend keeps its rooms when the others come and go
+        for (int i = 0; i < ROUTER_VNODES; i++){
+            char vnode[sizeof(entry->d_name) + 16];
+            snprintf(vnode, sizeof(vnode), "%s#%d", entry->d_name, i);
+            router.points[router.npoints].hash = router_hash(vnode);
+            router.points[router.npoints].backend = router.nbackends;
+            router.npoints += 1;
+        }
+        router.backends[router.nbackends++] = path;
+    }
+    closedir(dir);
+    qsort(router.points, router.npoints, sizeof(struct router_point), router_point_cmp);
+    printf("Routing to %d backends\n", router.nbackends);
+}
+
+/**
+ * Send client_fd to the backend listening at path, without waiting on it
+ *
+ * @return 0 on success, -1 if the backend couldn't be reached or its accept queue is full
+ */
+int send_handoff(char *path, int client_fd){
+    struct sockaddr_un addr;
+    memset(&addr, '\0', sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    // non-blocking, so a stalled backend with a full accept queue fails with EAGAIN instead of stalling the router
+    int backend_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (backend_fd == -1){
+        perror("router: socket");
+        return -1;
+    }
+    if (connect(backend_fd, (struct sockaddr *) &addr, sizeof(addr)) == -1){
+        close(backend_fd);
+        return -1;
+    }
+
+    char byte = 'c';
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, '\0', sizeof(msg));
+    memset(&control, '\0', sizeof(control));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &client_fd, sizeof(int));
+
+    int sent = (int) sendmsg(backend_fd, &msg, MSG_NOSIGNAL);
+    close(backend_fd);
+    return (sent == 1) ? 0 : -1;
+}
+
+/**
+ * Return the index of the first point on the ring at or after room's hash, wrapping around to 0
+ *
+ * Precondition: the ring has at least one point
+ */
+int router_find_point(char *room){
+    unsigned int h = router_hash(room);
+    int lo = 0, hi = router.npoints;
+    while (lo < hi){
+        int mid = (lo + hi) / 2;
+        if (router.points[mid].hash < h){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    return lo % router.npoints;
+}
+
+/**
+ * Hand client_fd to the backend that room hashes to. If that backend can't be reached (it was drained or its game
+ * is over), try the next one around the ring.
+ *
+ * @return the index of the backend the client went to, or -1 if none could take them
+ */
+int router_handoff(int client_fd, char *room){
+    router_rescan();
+    if (router.npoints == 0){
+        return -1;
+    }
+    int lo = router_find_point(room);
+    char tried[ROUTER_MAXBACKENDS] = {0};
+    for (int i = 0; i < router.npoints; i++){
+        int backend = router.points[(lo + i) % router.npoints].backend;
+        if (!tried[backend]){
+            tried[backend] = 1;
+            if (send_handoff(router.backends[backend], client_fd) == 0){
+                return backend;
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * Read whatever has arrived of client_fd's room name, and once the whole line is here, hand them off. Only the room
+ * line is consumed, so anything the client sent after it is left on the socket for the backend.
+ *
+ * @param client_fd
+ */
+void router_read_room(int client_fd){
+    struct router_client *client = router_clients[client_fd];
+    char peek_buf[MAXNAME+2];
+    int num_read = (int) recv(client_fd, peek_buf, MAXNAME + 1 - client->room_len, MSG_PEEK);
+    int newline_idx = (num_read > 0) ? find_newline_idx(peek_buf, num_read) : -1;
+    if (num_read > 0){
+        // take the room line, and the \r\n or \n at the end of it
+        int take = num_read;
+        if (newline_idx != -1){
+            take = newline_idx + 1 + (peek_buf[newline_idx] == '\r');
+        }
+        num_read = (int) read(client_fd, client->room + client->room_len, take);
+    }
+    if (num_read <= 0){
+        if (num_read == -1){
+            perror("router: read");
+        }
+        printf("A client has disconnected.\n");
+    }else if (newline_idx == -1 && client->room_len + num_read > MAXNAME){
+        router_write(client_fd, "The room name you entered is too long. Disconnecting.");
+    }else if (newline_idx == -1){
+        client->room_len += num_read;
+        return; // rest of the room name still to come
+    }else{
+        client->room_len += newline_idx;
+        if (client->room_len > 0 && client->room[client->room_len - 1] == '\r'){
+            client->room_len -= 1; // the \r of a \r\n split across reads
+        }
+        client->room[client->room_len] = '\0';
+        char *room = (client->room_len > 0) ? client->room : "lobby";
+        int backend = router_handoff(client_fd, room);
+        if (backend == -1){
+            router_write(client_fd, "No games are available right now. Try again later.");
+        }else{
+            printf("Sent a client to room %s on %s\n", room, router.backends[backend]);
+        }
+    }
+    // either way, we're done with them. if they were handed off, the backend has its own copy of the fd
+    close(client_fd);
+    free(client);
+    router_clients[client_fd] = NULL;
+}
+
+/**
+ * Accept clients on the -p port and route each one to a backend. Never returns.
+ */
+void run_router(){
+    makelistener();
+    router_rescan();
+
+    int max_fd = listenfd;
+    fd_set router_fds;
+    FD_ZERO(&router_fds);
+    FD_SET(listenfd, &router_fds);
+    while (1) {
+        fd_set router_fds_cpy = router_fds;
+        if (select(max_fd+1, &router_fds_cpy, NULL, NULL, NULL) == -1){
+            perror("router: select");
+            exit(1);
+        }
+        if (FD_ISSET(listenfd, &router_fds_cpy)){
+            int client_fd = accept(listenfd, NULL, NULL);
+            if (client_fd < 0){
+                perror("router: accept");
+            }else if (client_fd >= FD_SETSIZE){
+                close(client_fd);
+            }else{
+                printf("Accepted a new connection\n");
+                router_clients[client_fd] = malloc(sizeof(struct router_client));
+                router_clients[client_fd]->room_len = 0;
+                router_write(client_fd, "Welcome to Mancala. Which room would you like to join? (empty for the lobby)");
+                FD_SET(client_fd, &router_fds);
+                if (client_fd > max_fd){
+                    max_fd = client_fd;
+                }
+            }
+        }
+        for (int fd = 0; fd <= max_fd; fd++){
+            if (router_clients[fd] != NULL && FD_ISSET(fd, &router_fds_cpy)){
+                router_read_room(fd);
+                if (router_clients[fd] == NULL){
+                    FD_CLR(fd, &router_fds);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Listen for handoffs from the router on the unix socket at backend_path, instead of for clients on a port
+ */
+void make_backend_listener(){
+    struct sockaddr_un addr;
+    memset(&addr, '\0', sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(backend_path) >= sizeof(addr.sun_path)){
+        fprintf(stderr, "backend socket path %s is too long\n", backend_path);
+        exit(1);
+    }
+    strcpy(addr.sun_path, backend_path);
+
+    if ((listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        perror("socket");
+        exit(1);
+    }
+    unlink(backend_path); // left over from a backend that didn't get to clean up
+    if (bind(listenfd, (struct sockaddr *) &addr, sizeof(addr))) {
+        perror("bind");
+        exit(1);
+    }
+    struct stat st;
+    if (stat(backend_path, &st) == -1){
+        perror(backend_path);
+        exit(1);
+    }
+    backend_ino = st.st_ino;
+    if (listen(listenfd, 5)) {
+        perror("listen");
+        exit(1);
+    }
+}
+
+/**
+ * Accept a connection from the router on fd. The client's fd comes through it later, see finish_handoff
+ *
+ * @param fd the backend's listening socket
+ * @return the router connection, to be watched until it's readable. -1 if there wasn't one
+ */
+int accept_handoff(int fd){
+    int router_fd = accept(fd, NULL, NULL);
+    if (router_fd < 0){
+        if (errno != EAGAIN && errno != EWOULDBLOCK){
+            perror("backend: accept");
+        }
+        return -1;
+    }
+    if (router_fd >= FD_SETSIZE){
+        fprintf(stderr, "Too many clients. Dropped a new connection.\n");
+        close(router_fd);
+        return -1;
+    }
+    handoff_fds[nhandoffs++] = router_fd;
+    return router_fd;
+}
+
+/**
+ * Receive the client's fd over the readable router connection handoff_fds[i], and close that connection. Never
+ * blocks: if the fd isn't there, the client is dropped.
+ *
+ * @param i index of the router connection in handoff_fds. The last one is moved into its place
+ * @return the client's file descriptor, or -1 if none came through
+ */
+int finish_handoff(int i){
+    int router_fd = handoff_fds[i];
+    handoff_fds[i] = handoff_fds[--nhandoffs];
+    FD_CLR(router_fd, &monitored_fds);
+
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    memset(&msg, '\0', sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    int client_fd = -1;
+    if (recvmsg(router_fd, &msg, MSG_DONTWAIT) == 1){
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+            memcpy(&client_fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    if (client_fd < 0){
+        fprintf(stderr, "backend: the router didn't send a client\n");
+    }
+    close(router_fd);
+    return client_fd;
+}
+
+/**
+ * Once the game is over, send back every client the router handed us too late: the ones still waiting to be
+ * accepted, and the ones whose fd hasn't come through yet. Gives up on those once none arrive for HANDOFF_DRAIN_MS.
+ */
+void drain_handoffs(){
+    fcntl(listenfd, F_SETFL, O_NONBLOCK);
+    while (accept_handoff(listenfd) > -1){
+    }
+    while (nhandoffs > 0){
+        fd_set handoff_set;
+        FD_ZERO(&handoff_set);
+        int max_fd = -1;
+        for (int i = 0; i < nhandoffs; i++){
+            FD_SET(handoff_fds[i], &handoff_set);
+            if (handoff_fds[i] > max_fd){
+                max_fd = handoff_fds[i];
+            }
+        }
+        struct timeval timeout = {0, HANDOFF_DRAIN_MS * 1000};
+        if (select(max_fd + 1, &handoff_set, NULL, NULL, &timeout) <= 0){
+            break;
+        }
+        int i = 0;
+        while (i < nhandoffs){
+            if (FD_ISSET(handoff_fds[i], &handoff_set)){
+                int late_fd = finish_handoff(i);
+                if (late_fd > -1){
+                    router_write(late_fd, "That game just ended. Reconnect to join another one.");
+                    close(late_fd);
+                }
+            }else{
+                i++;
+            }
+        }
+    }
+    for (int i = 0; i < nhandoffs; i++){
+        close(handoff_fds[i]);
+    }
+    nhandoffs = 0;
+}
+
+
+#ifdef MANCBENCH
+/*
+ * Benchmarks and a differential fuzzer for the game engine. Every player writes to its own /dev/null fd, and stdout
+ * is pointed at /dev/null while the engine runs, so only the report makes it to the terminal.
+ *
+ * Usage: ./mancbench [-o results_file] [-c baseline_file] [-t tolerance_pct] [-n fuzz_cases] [-s seed]
+ * Results are saved as "name players density ns_per_op allocs_per_op" lines. With -c, the run fails if any
+ * benchmark got more than tolerance_pct (default 25) percent slower or allocates more than it does in baseline_file.
+ * ./mancbench -R runs the router test instead.
+ */
+#undef malloc
+
+#define MAXBENCH 64        /* maximum number of benchmark results */
+#define MAXFUZZPLAYERS 24  /* maximum number of players connected at once in a fuzz case */
+#define FUZZSTEPS 400      /* operations per fuzz case */
+
+struct bench_result {
+    char name[32];
+    int players;
+    int density;
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+long bench_allocs = 0;
+int bench_player_serial = 0;
+FILE *report;
+
+void *bench_malloc(size_t size){
+    bench_allocs += 1;
+    return malloc(size);
+}
+
+long bench_now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * Connect a new player the way new_conn_request does, minus the socket
+ *
+ * @param join: 1 if the player should also pick a name and join the game
+ * @return the new player
+ */
+struct player *bench_connect(int join){
+    struct player *player_ptr = malloc(sizeof(struct player));
+    add_player_to_head(player_ptr, 1);
+    player_ptr->fd = open("/dev/null", O_WRONLY);
+    if (player_ptr->fd < 0 || player_ptr->fd >= FD_SETSIZE){
+        fprintf(stderr, "bench: could not open a /dev/null fd for a player\n");
+        exit(1);
+    }
+    fd_owner[player_ptr->fd] = player_ptr;
+    snprintf(player_ptr->name, MAXNAME+1, "player%d", bench_player_serial++);
+    if (join){
+        add_user_to_game(player_ptr);
+    }
+    return player_ptr;
+}
+
+/** Disconnect every player, closing their fds **/
+void bench_disconnect_all(){
+    while (playerlist != NULL){
+        remove_from_list(playerlist->fd, NULL, 2);
+    }
+}
+
+/** Set every pit on every player to density pebbles **/
+void bench_fill_pits(int density){
+    for (struct player *p = playerlist; p; p = p->next){
+        for (int i = 0; i < NPITS; i++){
+            p->pits[i] = density;
+        }
+        p->pits[NPITS] = 0;
+    }
+}
+
+
+// REFERENCE ENGINE
+/*
+ * The linked-list engine the server shipped with, on a separate list of players, with the output stripped out.
+ * The one intended difference is that ref_set_next_mover wraps around to the newest player when nobody in the
+ * game connected before the current mover.
+ */
+
+int ref_set_next_mover(struct player *ref_list, struct player *current_mover){
+    struct player *start = ref_list;
+    if (current_mover != NULL && current_mover->next != NULL){
+        start = current_mover->next;
+    }
+    for (int wrapped = 0; wrapped < 2; wrapped++){
+        while (start != NULL){
+            if (start->in_game){
+                if (current_mover != NULL){
+                    current_mover->my_turn = 0;
+                }
+                start->my_turn = 1;
+                return 1;
+            }
+            start = start->next;
+        }
+        start = ref_list;
+    }
+    return 0;
+}
+
+void ref_make_move(struct player *ref_list, struct player *player_side, int start_pit, int pebbles, int use_endpit){
+    if (player_side != NULL && player_side->in_game && pebbles > 0){
+        for (int i = start_pit; i <= NPITS; i++){
+            if (player_side->my_turn && i == NPITS && use_endpit && pebbles == 1){
+                player_side->my_turn = 2;
+            }
+            if (pebbles > 0 && ((i < NPITS) || use_endpit)){
+                pebbles -= 1;
+                player_side->pits[i] += 1;
+            }else if(pebbles == 0){
+                break;
+            }
+        }
+    }
+    if (pebbles > 0){
+        struct player *next = ref_list;
+        if (player_side != NULL){
+            next = player_side->next;
+        }
+        ref_make_move(ref_list, next, 0, pebbles, 0);
+    }
+}
+
+void ref_process_move(struct player *ref_list, struct player *client, int pit_to_move){
+    if (pit_to_move < 0 || !client->my_turn || pit_to_move >= NPITS || client->pits[pit_to_move] == 0){
+        return;
+    }
+    int pebbles = client->pits[pit_to_move];
+    client->pits[pit_to_move] = 0;
+    ref_make_move(ref_list, client, pit_to_move+1, pebbles, 1);
+    if (client->my_turn == 2){
+        client->my_turn = 1;
+    }else{
+        ref_set_next_mover(ref_list, client);
+    }
+}
+
+/* call this BEFORE linking the new player in to the list */
+int ref_compute_average_pebbles(struct player *ref_list){
+    if (ref_list == NULL){
+        return NPEBBLES;
+    }
+    int nplayers = 0, npebbles = 0;
+    for (struct player *p = ref_list; p; p = p->next){
+        nplayers++;
+        for (int i = 0; i < NPITS; i++){
+            npebbles += p->pits[i];
+        }
+    }
+    return ((npebbles - 1) / nplayers / NPITS + 1);  /* round up */
+}
+
+/**
+ * Set up a newly connected player and add them to the head of ref_list
+ *
+ * @return the new head of ref_list
+ */
+struct player *ref_add_player_to_head(struct player *ref_list, struct player *player_ptr){
+    if (ref_list != NULL){
+        player_ptr->player_num = (1 + ref_list->player_num);
+        player_ptr->my_turn = 0;
+    }else{
+        player_ptr->player_num = 1;
+        player_ptr->my_turn = 1;
+    }
+    player_ptr->in_game = 0;
+    int num_pebbles = (player_ptr->player_num == 1) ? NPEBBLES : ref_compute_average_pebbles(ref_list);
+    for (int i = 0; i < NPITS; i++){
+        player_ptr->pits[i] = num_pebbles;
+    }
+    player_ptr->pits[NPITS] = 0;
+    player_ptr->next = ref_list;
+    return player_ptr;
+}
+
+/**
+ * Unlink removed from ref_list, renumbering the players ahead of it, and pass the turn on if it was theirs
+ *
+ * @return the new head of ref_list
+ */
+struct player *ref_remove_from_list(struct player *ref_list, struct player *removed){
+    if (ref_list == removed){
+        ref_list = removed->next;
+    }else{
+        struct player *p = ref_list;
+        while (p != NULL){
+            p->player_num -= 1;
+            if (p->next == removed){
+                p->next = removed->next;
+                break;
+            }
+            p = p->next;
+        }
+    }
+    if (removed->my_turn){
+        ref_set_next_mover(ref_list, removed);
+    }
+    return ref_list;
+}
+
+int ref_game_is_over(struct player *ref_list){
+    if (!ref_list){
+        return 0;
+    }
+    for (struct player *p = ref_list; p; p = p->next){
+        int is_all_empty = 1;
+        for (int i = 0; i < NPITS; i++){
+            if (p->pits[i]){
+                is_all_empty = 0;
+            }
+        }
+        if (is_all_empty){
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+// DIFFERENTIAL FUZZER
+
+struct player *fuzz_live[MAXFUZZPLAYERS]; // fuzz_live[i] and fuzz_ref[i] are the same player in the two engines
+struct player *fuzz_ref[MAXFUZZPLAYERS];
+struct player *ref_list = NULL;
+int fuzz_nplayers = 0;
+
+/** Connect a player to both engines. Each engine deals the new player's turn and pebbles on its own **/
+void fuzz_connect(int join){
+    struct player *live = bench_connect(join);
+    struct player *ref = malloc(sizeof(struct player));
+    ref_list = ref_add_player_to_head(ref_list, ref);
+    snprintf(ref->name, MAXNAME+1, "%s", live->name);
+    ref->fd = live->fd;
+    ref->in_game = join;
+    fuzz_live[fuzz_nplayers] = live;
+    fuzz_ref[fuzz_nplayers] = ref;
+    fuzz_nplayers += 1;
+}
+
+/** Disconnect fuzz_live[idx] and its reference copy **/
+void fuzz_disconnect(int idx){
+    ref_list = ref_remove_from_list(ref_list, fuzz_ref[idx]);
+    free(fuzz_ref[idx]);
+    remove_from_list(fuzz_live[idx]->fd, NULL, 2);
+    fuzz_nplayers -= 1;
+    fuzz_live[idx] = fuzz_live[fuzz_nplayers];
+    fuzz_ref[idx] = fuzz_ref[fuzz_nplayers];
+}
+
+/**
+ * Compare the two engines
+ *
+ * @return 1 if every player has the same board, turn and in_game flag in both and they agree on game over
+ */
+int fuzz_states_match(){
+    for (int i = 0; i < fuzz_nplayers; i++){
+        struct player *live = fuzz_live[i], *ref = fuzz_ref[i];
+        if (live->in_game != ref->in_game || live->my_turn != ref->my_turn ||
+            memcmp(live->pits, ref->pits, sizeof(live->pits)) != 0){
+            fprintf(report, "  %s differs: live my_turn=%d ref my_turn=%d\n", live->name, live->my_turn,
+                    ref->my_turn);
+            return 0;
+        }
+    }
+    return game_is_over() == ref_game_is_over(ref_list);
+}
+
+/**
+ * Play ncases random games on both engines, connecting, naming, moving and disconnecting players at random
+ *
+ * @return 0 if the engines always agreed, 1 otherwise
+ */
+int run_fuzzer(int ncases, unsigned int seed){
+    srand(seed);
+    for (int c = 0; c < ncases; c++){
+        int step;
+        for (step = 0; step < FUZZSTEPS && !ref_game_is_over(ref_list); step++){
+            int op = rand() % 10;
+            if ((op == 0 || fuzz_nplayers == 0) && fuzz_nplayers < MAXFUZZPLAYERS){
+                fuzz_connect(rand() % 3 != 0);
+            }else if (op == 1){
+                int idx = rand() % fuzz_nplayers;
+                if (!fuzz_live[idx]->in_game){
+                    add_user_to_game(fuzz_live[idx]);
+                    fuzz_ref[idx]->in_game = 1;
+                }
+            }else if (op == 2 && rand() % 4 == 0){
+                fuzz_disconnect(rand() % fuzz_nplayers);
+            }else{
+                // mostly the mover, sometimes someone else or a bad pit
+                int idx = rand() % fuzz_nplayers;
+                for (int i = 0; i < fuzz_nplayers && rand() % 8 != 0; i++){
+                    if (fuzz_live[i]->my_turn){
+                        idx = i;
+                    }
+                }
+                int pit = rand() % (NPITS + 2) - 1;
+                if (fuzz_live[idx]->in_game){
+                    process_move(fuzz_live[idx], pit);
+                    ref_process_move(ref_list, fuzz_ref[idx], pit);
+                }
+            }
+            if (!fuzz_states_match()){
+                fprintf(report, "fuzz: engines diverged in case %d (seed %u) at step %d\n", c, seed, step);
+                return 1;
+            }
+        }
+        while (fuzz_nplayers > 0){
+            fuzz_disconnect(fuzz_nplayers - 1);
+        }
+    }
+    fprintf(report, "fuzz: %d cases matched the reference engine (seed %u)\n", ncases, seed);
+    return 0;
+}
+
+
+// BENCHMARKS
+
+struct bench_result bench_results[MAXBENCH];
+int nbench_results = 0;
+
+/**
+ * Run op over and over, doubling the iteration count until a run takes at least 50ms, and record its cost
+ *
+ * @param name
+ * @param players
+ * @param density
+ * @param op: the operation to time. Returns the number of ns spent on anything that shouldn't be counted.
+ */
+void run_bench(char *name, int players, int density, long (*op)(long)){
+    long iters = 1, elapsed, allocs;
+    do {
+        iters *= 2;
+        long allocs_before = bench_allocs;
+        long start = bench_now_ns();
+        long excluded = op(iters);
+        elapsed = bench_now_ns() - start - excluded;
+        allocs = bench_allocs - allocs_before;
+    } while (elapsed < 50000000L && iters < (1L << 30));
+
+    struct bench_result *r = &bench_results[nbench_results++];
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    r->players = players;
+    r->density = density;
+    r->ns_per_op = (double) elapsed / iters;
+    r->allocs_per_op = (double) allocs / iters;
+    fprintf(report, "%-16s players=%-4d density=%-4d %10.1f ns/op %6.2f allocs/op\n", name, players, density,
+            r->ns_per_op, r->allocs_per_op);
+}
+
+int bench_density;
+int bench_render_fd;
+int bench_parse_fds[2];
+
+long bench_make_move(long iters){
+    struct player *p = playerlist;
+    for (long i = 0; i < iters; i++){
+        make_move(p, 1, bench_density, 1);
+        p->my_turn = p->my_turn ? 1 : 0;
+        p = p->next ? p->next : playerlist;
+    }
+    return 0;
+}
+
+long bench_render(long iters){
+    for (long i = 0; i < iters; i++){
+        print_game_state(bench_render_fd);
+    }
+    return 0;
+}
+
+long bench_broadcast(long iters){
+    for (long i = 0; i < iters; i++){
+        broadcast("player0 has joined the game.", NULL, 0);
+    }
+    return 0;
+}
+
+long bench_parse(long iters){
+    // refill the socket with moves outside the timed part, one datagram per move
+    long excluded = 0;
+    for (long done = 0; done < iters; ){
+        long start = bench_now_ns();
+        long batch = (iters - done < 64) ? iters - done : 64;
+        for (long i = 0; i < batch; i++){
+            if (write(bench_parse_fds[1], "3\r\n", 3) != 3){
+                perror("bench: write");
+                exit(1);
+            }
+        }
+        excluded += bench_now_ns() - start;
+        for (long i = 0; i < batch; i++){
+            read_and_parse(bench_parse_fds[0], MAXMESSAGE, NULL);
+        }
+        done += batch;
+    }
+    return excluded;
+}
+
+void run_benchmarks(){
+    int player_counts[] = {2, 8, 64, 256};
+    int densities[] = {4, 16, 64};
+    int nplayer_counts = (int) (sizeof(player_counts) / sizeof(player_counts[0]));
+    int ndensities = (int) (sizeof(densities) / sizeof(densities[0]));
+
+    bench_render_fd = open("/dev/null", O_WRONLY);
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, bench_parse_fds) == -1){
+        perror("bench: socketpair");
+        exit(1);
+    }
+    run_bench("read_and_parse", 0, 0, bench_parse);
+
+    for (int i = 0; i < nplayer_counts; i++){
+        for (int j = 0; j < player_counts[i]; j++){
+            bench_connect(1);
+        }
+        run_bench("broadcast", player_counts[i], 0, bench_broadcast);
+        for (int j = 0; j < ndensities; j++){
+            bench_density = densities[j];
+            bench_fill_pits(bench_density);
+            run_bench("make_move", player_counts[i], bench_density, bench_make_move);
+            bench_fill_pits(bench_density);
+            run_bench("print_game_state", player_counts[i], bench_density, bench_render);
+        }
+        bench_disconnect_all();
+    }
+    close(bench_render_fd);
+    close(bench_parse_fds[0]);
+    close(bench_parse_fds[1]);
+}
+
+/** Save the results to results_file, one benchmark per line **/
+void save_results(char *results_file){
+    FILE *f = fopen(results_file, "w");
+    if (f == NULL){
+        perror(results_file);
+        exit(1);
+    }
+    for (int i = 0; i < nbench_results; i++){
+        struct bench_result *r = &bench_results[i];
+        fprintf(f, "%s %d %d %.1f %.2f\n", r->name, r->players, r->density, r->ns_per_op, r->allocs_per_op);
+    }
+    fclose(f);
+}
+
+/**
+ * Compare the results against the ones saved in baseline_file. A benchmark in baseline_file that didn't run this
+ * time counts as a regression.
+ *
+ * @return the number of benchmarks that regressed
+ */
+int check_regressions(char *baseline_file, int tolerance_pct){
+    FILE *f = fopen(baseline_file, "r");
+    if (f == NULL){
+        perror(baseline_file);
+        exit(1);
+    }
+    int regressions = 0;
+    struct bench_result base;
+    while (fscanf(f, "%31s %d %d %lf %lf", base.name, &base.players, &base.density, &base.ns_per_op,
+                  &base.allocs_per_op) == 5){
+        int found = 0;
+        for (int i = 0; i < nbench_results; i++){
+            struct bench_result *r = &bench_results[i];
+            if (strcmp(r->name, base.name) != 0 || r->players != base.players || r->density != base.density){
+                continue;
+            }
+            found = 1;
+            if (r->ns_per_op > base.ns_per_op * (100 + tolerance_pct) / 100 ||
+                r->allocs_per_op > base.allocs_per_op + 0.005){
+                fprintf(report, "regression: %s players=%d density=%d: %.1f ns/op %.2f allocs/op "
+                        "(baseline %.1f ns/op %.2f allocs/op)\n", r->name, r->players, r->density,
+                        r->ns_per_op, r->allocs_per_op, base.ns_per_op, base.allocs_per_op);
+                regressions += 1;
+            }
+        }
+        if (!found){
+            fprintf(report, "regression: %s players=%d density=%d is in the baseline but didn't run\n", base.name,
+                    base.players, base.density);
+            regressions += 1;
+        }
+    }
+    fclose(f);
+    return regressions;
+}
+
+// ROUTER TEST
+/*
+ * Runs a router and backends (server_main in child processes) on a temp dir and checks them as clients would:
+ * routing by room, the SCM_RIGHTS handoff, a name sent right after the room line, a backend not waiting on a silent
+ * connection, draining and adding a backend, and the router staying responsive while its backends are stopped.
+ */
+
+#define RTEST_TIMEOUT_MS 2000
+#define RTEST_NSTALLED 20 /* clients sent to stopped backends, more than their accept queues hold */
+
+struct rtest_client {
+    int fd;
+    char buf[8192]; // everything received since the last rtest_clear
+    int len;
+};
+
+char rtest_dir[] = "/tmp/mancrouterXXXXXX";
+char rtest_paths[3][sizeof(rtest_dir) + 16]; // backend socket paths
+pid_t rtest_pids[4];
+int rtest_npids = 0;
+int rtest_port;
+struct rtest_client rtest_clients[RTEST_NSTALLED + 8];
+
+/** Run a server with args in a child process **/
+pid_t rtest_spawn(char **args){
+    pid_t pid = fork();
+    if (pid == -1){
+        perror("rtest: fork");
+        exit(1);
+    }
+    if (pid == 0){
+        int argc = 0;
+        while (args[argc] != NULL){
+            argc++;
+        }
+        optind = 1;
+        router_dir = NULL; // rtest_room_on sets it in the test process
+        backend_path = NULL;
+        exit(server_main(argc, args));
+    }
+    rtest_pids[rtest_npids++] = pid;
+    return pid;
+}
+
+/** Start a backend listening at rtest_paths[idx], and wait for its socket to show up **/
+pid_t rtest_spawn_backend(int idx){
+    snprintf(rtest_paths[idx], sizeof(rtest_paths[idx]), "%s/b%d.sock", rtest_dir, idx);
+    char *args[] = {"mancsrv", "-b", rtest_paths[idx], NULL};
+    pid_t pid = rtest_spawn(args);
+    struct stat st;
+    for (int i = 0; i < RTEST_TIMEOUT_MS / 10 && stat(rtest_paths[idx], &st) == -1; i++){
+        usleep(10000);
+    }
+    return pid;
+}
+
+/** Return a port nobody is listening on right now **/
+int rtest_free_port(){
+    struct sockaddr_in r;
+    socklen_t len = sizeof(r);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&r, '\0', sizeof(r));
+    r.sin_family = AF_INET;
+    r.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd == -1 || bind(fd, (struct sockaddr *) &r, sizeof(r)) || getsockname(fd, (struct sockaddr *) &r, &len)){
+        perror("rtest: finding a port");
+        exit(1);
+    }
+    close(fd);
+    return ntohs(r.sin_port);
+}
+
+/** Connect c to the router, retrying while it starts up **/
+int rtest_connect(struct rtest_client *c){
+    struct sockaddr_in r;
+    memset(&r, '\0', sizeof(r));
+    r.sin_family = AF_INET;
+    r.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    r.sin_port = htons(rtest_port);
+    c->len = 0;
+    for (int i = 0; i < RTEST_TIMEOUT_MS / 10; i++){
+        c->fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(c->fd, (struct sockaddr *) &r, sizeof(r)) == 0){
+            return 0;
+        }
+        close(c->fd);
+        usleep(10000);
+    }
+    return -1;
+}
+
+void rtest_send(struct rtest_client *c, char *s){
+    if (send(c->fd, s, strlen(s), MSG_NOSIGNAL) == -1){
+        perror("rtest: send");
+    }
+}
+
+void rtest_clear(struct rtest_client *c){
+    c->len = 0;
+}
+
+/**
+ * Wait up to timeout_ms for needle to show up in what c has received
+ *
+ * @return 1 if it did, 0 otherwise
+ */
+int rtest_expect(struct rtest_client *c, char *needle, int timeout_ms){
+    long deadline = bench_now_ns() + timeout_ms * 1000000L;
+    while (1){
+        c->buf[c->len] = '\0';
+        if (strstr(c->buf, needle) != NULL){
+            return 1;
+        }
+        long left = deadline - bench_now_ns();
+        if (left <= 0){
+            return 0;
+        }
+        struct timeval tv = {left / 1000000000L, (left % 1000000000L) / 1000};
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(c->fd, &fds);
+        if (select(c->fd + 1, &fds, NULL, NULL, &tv) > 0){
+            if (c->len == sizeof(c->buf) - 1){
+                c->len = 0; // only the newest output matters
+            }
+            int num_read = (int) read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+            if (num_read <= 0){
+                return 0;
+            }
+            c->len += num_read;
+        }
+    }
+}
+
+/** Connect a client and send the room line and their name in one write **/
+int rtest_join(struct rtest_client *c, char *room, char *name){
+    char line[2 * MAXNAME + 4];
+    if (rtest_connect(c) == -1 || !rtest_expect(c, "Which room", RTEST_TIMEOUT_MS)){
+        return 0;
+    }
+    snprintf(line, sizeof(line), "%s\r\n%s\n", room, name);
+    rtest_send(c, line);
+    snprintf(line, sizeof(line), "%s:  [0]", name); // their board, which they only get once they're in a game
+    return rtest_expect(c, line, RTEST_TIMEOUT_MS);
+}
+
+/** Kill every server we started and remove the temp dir **/
+void rtest_cleanup(){
+    for (int i = 0; i < rtest_npids; i++){
+        kill(rtest_pids[i], SIGKILL);
+        waitpid(rtest_pids[i], NULL, 0);
+    }
+    for (int i = 0; i < 3; i++){
+        if (rtest_paths[i][0] != '\0'){
+            unlink(rtest_paths[i]);
+        }
+    }
+    rmdir(rtest_dir);
+}
+
+/**
+ * Find a room that the router will send to the backend listening at path
+ *
+ * @param path
+ * @param skip: the number of such rooms to skip, to get a different one
+ * @param room: where to put the room. At least 32 chars
+ */
+void rtest_room_on(char *path, int skip, char *room){
+    router_dir = rtest_dir;
+    router_rescan();
+    for (int i = 0; i < 10000; i++){
+        snprintf(room, 32, "room%d", i);
+        if (strcmp(router.backends[router.points[router_find_point(room)].backend], path) == 0 && skip-- == 0){
+            return;
+        }
+    }
+    fprintf(report, "rtest: no room hashes to %s\n", path);
+    rtest_cleanup();
+    exit(1);
+}
+
+/**
+ * Record the result of one check
+ *
+ * @return ok
+ */
+int rtest_check(int ok, char *what){
+    fprintf(report, "router: %-60s %s\n", what, ok ? "ok" : "FAILED");
+    return ok;
+}
+
+/**
+ * Run the router test
+ *
+ * @return 0 if every check passed, 1 otherwise
+ */
+int run_router_test(){
+    struct rtest_client *alice = &rtest_clients[0], *bob = &rtest_clients[1], *carol = &rtest_clients[2];
+    struct rtest_client *dave = &rtest_clients[3], *erin = &rtest_clients[4];
+    struct rtest_client *frank = &rtest_clients[RTEST_NSTALLED + 5];
+    char port_arg[16];
+    int ok = 1;
+
+    if (mkdtemp(rtest_dir) == NULL){
+        perror("rtest: mkdtemp");
+        return 1;
+    }
+    rtest_spawn_backend(0);
+    pid_t b1 = rtest_spawn_backend(1);
+    rtest_port = rtest_free_port();
+    snprintf(port_arg, sizeof(port_arg), "%d", rtest_port);
+    char *router_args[] = {"mancsrv", "-p", port_arg, "-r", rtest_dir, NULL};
+    rtest_spawn(router_args);
+
+    char a_room[32], a_room2[32], b_room[32], b_room2[32], c_room[32];
+    rtest_room_on(rtest_paths[0], 0, a_room);
+    rtest_room_on(rtest_paths[0], 1, a_room2);
+    rtest_room_on(rtest_paths[1], 0, b_room);
+
+    ok &= rtest_check(rtest_join(alice, a_room, "alice"), "handoff, with the name sent right after the room line");
+    ok &= rtest_check(rtest_join(bob, a_room2, "bob") && rtest_expect(alice, "bob has joined", RTEST_TIMEOUT_MS),
+                      "rooms on the same backend share its game");
+    ok &= rtest_check(rtest_join(carol, b_room, "carol"), "the other backend takes its rooms");
+
+    // a local connection to b1 that never sends a client shouldn't hold up anyone the router sends there
+    struct sockaddr_un silent_addr;
+    memset(&silent_addr, '\0', sizeof(silent_addr));
+    silent_addr.sun_family = AF_UNIX;
+    strncpy(silent_addr.sun_path, rtest_paths[1], sizeof(silent_addr.sun_path) - 1);
+    int silent_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (silent_fd == -1 || connect(silent_fd, (struct sockaddr *) &silent_addr, sizeof(silent_addr)) == -1){
+        perror("rtest: connecting to a backend");
+    }
+    rtest_room_on(rtest_paths[1], 1, b_room2);
+    ok &= rtest_check(rtest_join(frank, b_room2, "frank") && rtest_expect(carol, "frank has joined", RTEST_TIMEOUT_MS),
+                      "a backend doesn't wait on a connection that sends no client");
+    ok &= rtest_check(!rtest_expect(alice, "carol", 300) && !rtest_expect(carol, "alice", 0),
+                      "rooms on different backends are different games");
+
+    // drain b0: its game goes on, and its rooms move to b1
+    unlink(rtest_paths[0]);
+    ok &= rtest_check(rtest_join(dave, a_room, "dave") && rtest_expect(carol, "dave has joined", RTEST_TIMEOUT_MS),
+                      "a drained backend's room moves to the next backend");
+    ok &= rtest_check(!rtest_expect(alice, "dave", 300), "a drained backend gets no new clients");
+    rtest_clear(alice);
+    rtest_send(alice, "9\n");
+    ok &= rtest_check(rtest_expect(alice, "Invalid move", RTEST_TIMEOUT_MS), "a drained backend's game goes on");
+
+    // add b2
+    pid_t b2 = rtest_spawn_backend(2);
+    rtest_room_on(rtest_paths[2], 0, c_room);
+    ok &= rtest_check(rtest_join(erin, c_room, "erin") && !rtest_expect(erin, "carol", 300),
+                      "an added backend takes its rooms");
+
+    // stop every backend. the router should still answer everyone
+    kill(b1, SIGSTOP);
+    kill(b2, SIGSTOP);
+    int answered = 1;
+    struct rtest_client *last = NULL;
+    for (int i = 0; i < RTEST_NSTALLED && answered; i++){
+        last = &rtest_clients[5 + i];
+        answered = rtest_connect(last) == 0 && rtest_expect(last, "Which room", RTEST_TIMEOUT_MS);
+        rtest_send(last, b_room);
+        rtest_send(last, "\n");
+    }
+    ok &= rtest_check(answered, "the router keeps answering while its backends are stopped");
+    ok &= rtest_check(rtest_expect(last, "No games are available", RTEST_TIMEOUT_MS),
+                      "clients are turned away once the backends' queues are full");
+    kill(b1, SIGCONT);
+    kill(b2, SIGCONT);
+
+    close(silent_fd);
+    rtest_cleanup();
+    return !ok;
+}
+
+
+int main(int argc, char **argv){
+    char *results_file = "bench_output.txt";
+    char *baseline_file = NULL;
+    int tolerance_pct = 25, ncases = 2000;
+    unsigned int seed = (unsigned int) time(NULL);
+    int c, status = 0, router_test = 0;
+    while ((c = getopt(argc, argv, "o:c:t:n:s:R")) != EOF) {
+        switch (c) {
+        case 'R':
+            router_test = 1;
+            break;
+        case 'o':
+            results_file = optarg;
+            break;
+        case 'c':
+            baseline_file = optarg;
+            break;
+        case 't':
+            tolerance_pct = strtol(optarg, NULL, 0);
+            break;
+        case 'n':
+            ncases = strtol(optarg, NULL, 0);
+            break;
+        case 's':
+            seed = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            status++;
+        }
+    }
+    if (status || optind != argc) {
+        fprintf(stderr, "usage: %s [-o results_file] [-c baseline_file] [-t tolerance_pct] [-n fuzz_cases] "
+                "[-s seed] | -R\n", argv[0]);
+        exit(1);
+    }
+
+    // keep the engine's printfs out of the report
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    setvbuf(report, NULL, _IOLBF, 0);
+    int devnull = open("/dev/null", O_WRONLY);
+    fflush(stdout);
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+    FD_ZERO(&monitored_fds);
+
+    if (router_test){
+        return run_router_test();
+    }
+    if (run_fuzzer(ncases, seed)){
+        return 1;
+    }
+    run_benchmarks();
+    save_results(results_file);
+    fprintf(report, "results saved to %s\n", results_file);
+    if (baseline_file != NULL && check_regressions(baseline_file, tolerance_pct) > 0){
+        return 1;
+    }
+    return 0;
+}
+#endif